@@ -23,6 +23,7 @@
 /// <summary>
 /// Retrieves an option of the plugin script measure
 /// </summary>
+/// <remarks>The returned string is owned by Rainmeter and is only valid until the next call to an Rm function. Copy it (e.g. to a std::wstring) to keep it.</remarks>
 /// <param name="rm">Pointer to the plugin measure</param>
 /// <param name="option">Option name</param>
 /// <param name="defValue">Default value for the option if it is not found or invalid</param>
@@ -41,7 +42,7 @@ LIBRARY_EXPORT LPCWSTR __stdcall RmReadString(void* rm, LPCWSTR option, LPCWSTR
 /// <summary>
 /// Retrieves an option of a meter/measure
 /// </summary>
-/// <remarks>In older Rainmeter versions without support for this API, always returns the default value</remarks>
+/// <remarks>In older Rainmeter versions without support for this API, always returns the default value. The returned string is owned by Rainmeter, see RmReadString.</remarks>
 /// <param name="rm">Pointer to the plugin measure</param>
 /// <param name="section">Meter/measure section name</param>
 /// <param name="option">Option name</param>
@@ -169,6 +170,7 @@ __inline double RmReadDoubleFromSection(void* rm, LPCWSTR section, LPCWSTR optio
 /// <summary>
 /// Returns a string, replacing any variables (or section variables) within the inputted string
 /// </summary>
+/// <remarks>The returned string is owned by Rainmeter, see RmReadString.</remarks>
 /// <param name="rm">Pointer to the plugin measure</param>
 /// <param name="str">String with unresolved variables</param>
 /// <returns>Returns a string replacing any variables in the 'str'</returns>
@@ -188,6 +190,7 @@ LIBRARY_EXPORT LPCWSTR __stdcall RmReplaceVariables(void* rm, LPCWSTR str);
 /// <summary>
 /// Converts a relative path to a absolute path (use RmReadPath where appropriate)
 /// </summary>
+/// <remarks>The returned string is owned by Rainmeter, see RmReadString.</remarks>
 /// <param name="rm">Pointer to the plugin measure</param>
 /// <param name="relativePath">String of path to be converted</param>
 /// <returns>Returns the absolute path of the relativePath value as a string (LPCWSTR)</returns>
@@ -293,6 +296,7 @@ LIBRARY_EXPORT BOOL __cdecl LSLog(int level, LPCWSTR unused, LPCWSTR message);
 /// <summary>
 /// Retrieves the option defined in the skin file and converts a relative path to a absolute path
 /// </summary>
+/// <remarks>The returned string is owned by Rainmeter, see RmReadString.</remarks>
 /// <param name="rm">Pointer to the plugin measure</param>
 /// <param name="option">Option name to be read from skin</param>
 /// <param name="defValue">Default value for the option if it is not found or invalid</param>
@@ -7,6 +7,12 @@
 
 #include <Windows.h>
 #include "../../API/RainmeterAPI.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 
 // Overview: This example demonstrates using both the data argument to keep data across
@@ -15,6 +21,20 @@
 // of updates that happen and saves it when the skin unloads to the |Rainmeter.data| file.
 // Note: Remember that the Update function will not be called when the measure is paused or disabled.
 
+// The |Plugin_DataHandling| section of the data file is read only once per process and kept
+// in memory. Each measure has its own key (skin and measure name), so measures do not overwrite
+// each other. Changes are written back in one go once no measure has been unloaded for a few
+// seconds (e.g. after a skin refresh), and when the last measure is unloaded. The in-memory
+// copy is kept for as long as the plugin is loaded, so a refreshed skin does not read the data
+// file again.
+
+// To not lose the counters if Rainmeter crashes, every change of a measure with SaveData=1 is
+// also recorded in a small journal file next to the data file. The records of an update cycle
+// are collected in memory and appended with a single write. The journal is replayed when the
+// data is loaded and emptied each time the section is written to the data file. The options
+// |SyncUpdates| and |SyncSeconds| control how often the journal is flushed to disk, which is
+// done on a separate thread so that the skin does not wait for the disk.
+
 //Sample skin:
 /*
 	[Rainmeter]
@@ -27,6 +47,8 @@
 	Measure=Plugin
 	Plugin=DataHandling
 	SaveData=1
+	SyncUpdates=100
+	SyncSeconds=10
 
 	[mCountAt0]
 	Measure=Plugin
@@ -48,22 +70,409 @@ struct Measure
 	int counter;
 	bool saveData;
 
-	LPCWSTR dataFile;
+	std::wstring key;
+	int* storedValue;  // Points into |DataStore::values| while SaveData=1
+	bool pendingRecord;  // Has a record in |DataStore::record|
 
 	Measure() :
 		counter(0),
 		saveData(false),
-		dataFile(nullptr) {}
+		key(),
+		storedValue(nullptr),
+		pendingRecord(false) {}
 };
 
+struct DataStore
+{
+	LPCWSTR dataFile;
+	std::unordered_map<std::wstring, int> values;
+	int measureCount;
+
+	bool dirty;  // |values| has changes that are not in the data file yet
+	bool flushPending;
+	ULONGLONG lastChange;
+
+	HANDLE journal;
+	std::vector<BYTE> record;  // Records of the current update cycle, not written yet
+	std::vector<Measure*> pendingMeasures;  // Measures that added a record to |record|
+	DWORD journalRecords;
+	DWORD unsyncedRecords;
+	ULONGLONG lastSync;
+	DWORD syncUpdates;
+	ULONGLONG syncInterval;
+
+	// The journal is flushed to disk by |syncThread|, shared state is protected by |syncMutex|
+	std::thread syncThread;
+	std::mutex syncMutex;
+	std::condition_variable syncWake;
+	bool syncRequested;
+	bool syncStop;
+
+	DataStore() :
+		dataFile(nullptr),
+		values(),
+		measureCount(0),
+		dirty(false),
+		flushPending(false),
+		lastChange(0),
+		journal(INVALID_HANDLE_VALUE),
+		record(),
+		pendingMeasures(),
+		journalRecords(0),
+		unsyncedRecords(0),
+		lastSync(0),
+		syncUpdates(100),
+		syncInterval(10000),
+		syncThread(),
+		syncMutex(),
+		syncWake(),
+		syncRequested(false),
+		syncStop(false) {}
+
+	~DataStore()
+	{
+		// The sync thread has already been stopped when the last measure was unloaded
+		if (journal != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(journal);
+		}
+	}
+};
+
+// Shared by all measures. Note that all plugin functions are called on the same thread.
+DataStore g_Store;
+
+// Time (in milliseconds) without changes before the data is written to the data file
+const ULONGLONG FLUSH_DELAY = 5000;
+
+// Number of journal records after which the data is written to the data file and the journal
+//  is emptied. Since writing the data file takes longer the more values there are, the journal
+//  may hold |COMPACT_RECORDS_PER_VALUE| records per value if that is more. This way the data
+//  file is written about every 100 update cycles at most, no matter how many measures there are.
+const DWORD COMPACT_RECORDS = 10000;
+const DWORD COMPACT_RECORDS_PER_VALUE = 100;
+
+// Each journal record is laid out as:
+//   DWORD size   Size of the payload in bytes
+//   DWORD crc    CRC-32 of the payload
+//   INT   value  } payload
+//   WCHAR key[]  } (not null-terminated)
+// Replaying stops at the first record that is incomplete or fails the checksum.
+const DWORD RECORD_HEADER_SIZE = 2 * sizeof(DWORD);
+const DWORD MAX_RECORD_SIZE = 4096;
+
+DWORD Crc32(const BYTE* data, size_t size)
+{
+	static DWORD table[256] = {0};
+	if (!table[1])
+	{
+		for (DWORD i = 0; i < 256; ++i)
+		{
+			DWORD crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+			}
+			table[i] = crc;
+		}
+	}
+
+	DWORD crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+void ReplayJournal()
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(g_Store.journal, &size) || size.QuadPart == 0 || size.QuadPart > MAXDWORD)
+	{
+		return;
+	}
+
+	std::vector<BYTE> buffer((size_t)size.QuadPart);
+	DWORD read = 0;
+	if (!ReadFile(g_Store.journal, buffer.data(), (DWORD)buffer.size(), &read, nullptr))
+	{
+		return;
+	}
+
+	const BYTE* pos = buffer.data();
+	const BYTE* end = pos + read;
+	while ((size_t)(end - pos) >= RECORD_HEADER_SIZE)
+	{
+		DWORD recordSize, crc;
+		memcpy(&recordSize, pos, sizeof(DWORD));
+		memcpy(&crc, pos + sizeof(DWORD), sizeof(DWORD));
+		const BYTE* payload = pos + RECORD_HEADER_SIZE;
+
+		if (recordSize < sizeof(INT) || recordSize > MAX_RECORD_SIZE ||
+			(recordSize - sizeof(INT)) % sizeof(WCHAR) != 0 ||
+			(size_t)(end - payload) < recordSize ||
+			Crc32(payload, recordSize) != crc)
+		{
+			// Torn or corrupted tail, e.g. after a crash while writing. Cut it off, so that new
+			//  records are not appended after it (where they could not be replayed) if the
+			//  data file cannot be written.
+			LARGE_INTEGER good;
+			good.QuadPart = pos - buffer.data();
+			SetFilePointerEx(g_Store.journal, good, nullptr, FILE_BEGIN);
+			SetEndOfFile(g_Store.journal);
+			break;
+		}
+
+		INT value;
+		memcpy(&value, payload, sizeof(INT));
+		std::wstring key((recordSize - sizeof(INT)) / sizeof(WCHAR), L'\0');
+		memcpy(&key[0], payload + sizeof(INT), recordSize - sizeof(INT));
+		g_Store.values[key] = value;
+		g_Store.dirty = true;
+
+		pos = payload + recordSize;
+	}
+}
+
+void SyncThread()
+{
+	std::unique_lock<std::mutex> lock(g_Store.syncMutex);
+	while (true)
+	{
+		g_Store.syncWake.wait(lock, [] { return g_Store.syncRequested || g_Store.syncStop; });
+		if (g_Store.syncRequested)
+		{
+			g_Store.syncRequested = false;
+			lock.unlock();
+			FlushFileBuffers(g_Store.journal);
+			lock.lock();
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+void StartSync()
+{
+	if (g_Store.journal == INVALID_HANDLE_VALUE || g_Store.syncThread.joinable()) return;
+
+	g_Store.syncStop = false;
+	g_Store.syncThread = std::thread(SyncThread);
+}
+
+// Waits until the journal has been flushed to disk for the last time
+void StopSync()
+{
+	if (!g_Store.syncThread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_Store.syncMutex);
+		// Keep a flush that has been requested but not done yet
+		g_Store.syncRequested = g_Store.syncRequested || g_Store.unsyncedRecords > 0;
+		g_Store.syncStop = true;
+	}
+	g_Store.syncWake.notify_one();
+	g_Store.syncThread.join();
+	g_Store.unsyncedRecords = 0;
+}
+
+void RequestSync()
+{
+	{
+		std::lock_guard<std::mutex> lock(g_Store.syncMutex);
+		g_Store.syncRequested = true;
+	}
+	g_Store.syncWake.notify_one();
+}
+
+// Forgets the records that have not been written yet
+void ClearPending()
+{
+	for (Measure* measure : g_Store.pendingMeasures)
+	{
+		measure->pendingRecord = false;
+	}
+	g_Store.pendingMeasures.clear();
+	g_Store.record.clear();
+}
+
+// Appends the records of the current update cycle to the journal with a single write
+void WriteJournal()
+{
+	if (g_Store.record.empty()) return;
+
+	DWORD written = 0;
+	WriteFile(g_Store.journal, g_Store.record.data(), (DWORD)g_Store.record.size(), &written, nullptr);
+	g_Store.journalRecords += (DWORD)g_Store.pendingMeasures.size();
+	g_Store.unsyncedRecords += (DWORD)g_Store.pendingMeasures.size();
+	ClearPending();
+
+	// The records are safe from a crash of Rainmeter once written. Flushing them to disk (to
+	//  survive a crash of the system) is expensive, so it is only done every now and then.
+	const ULONGLONG now = GetTickCount64();
+	if (g_Store.unsyncedRecords >= g_Store.syncUpdates ||
+		now - g_Store.lastSync >= g_Store.syncInterval)
+	{
+		RequestSync();
+		g_Store.unsyncedRecords = 0;
+		g_Store.lastSync = now;
+	}
+}
+
+void AppendJournal(Measure* measure, int value)
+{
+	if (g_Store.journal == INVALID_HANDLE_VALUE) return;
+
+	// If this measure already has a record waiting, a whole update cycle has passed. This does
+	//  not depend on any particular measure, since measures can be paused or disabled.
+	if (measure->pendingRecord)
+	{
+		WriteJournal();
+	}
+
+	const std::wstring& key = measure->key;
+	const DWORD keySize = (DWORD)(key.length() * sizeof(WCHAR));
+	const DWORD recordSize = (DWORD)sizeof(INT) + keySize;
+	if (recordSize > MAX_RECORD_SIZE) return;
+
+	std::vector<BYTE>& record = g_Store.record;
+	const size_t offset = record.size();
+	record.resize(offset + RECORD_HEADER_SIZE + recordSize);
+	BYTE* header = record.data() + offset;
+	BYTE* payload = header + RECORD_HEADER_SIZE;
+	memcpy(payload, &value, sizeof(INT));
+	memcpy(payload + sizeof(INT), key.c_str(), keySize);
+
+	const DWORD crc = Crc32(payload, recordSize);
+	memcpy(header, &recordSize, sizeof(DWORD));
+	memcpy(header + sizeof(DWORD), &crc, sizeof(DWORD));
+
+	measure->pendingRecord = true;
+	g_Store.pendingMeasures.push_back(measure);
+}
+
+void ClearJournal()
+{
+	// Records that have not been written yet are in the data file as well
+	ClearPending();
+
+	if (g_Store.journal != INVALID_HANDLE_VALUE)
+	{
+		SetFilePointer(g_Store.journal, 0, nullptr, FILE_BEGIN);
+		SetEndOfFile(g_Store.journal);
+		g_Store.journalRecords = 0;
+		g_Store.unsyncedRecords = 0;
+	}
+}
+
+void FlushStore()
+{
+	g_Store.flushPending = false;
+	if (!g_Store.dirty) return;
+
+	// Replace the whole section in a single write instead of rewriting the file for each key
+	std::wstring section;
+	WCHAR buffer[16];
+	for (const auto& value : g_Store.values)
+	{
+		_itow_s(value.second, buffer, 10);
+		section += value.first;
+		section += L'=';
+		section += buffer;
+		section += L'\0';
+	}
+	section += L'\0';
+
+	if (!WritePrivateProfileSection(L"Plugin_DataHandling", section.c_str(), g_Store.dataFile))
+	{
+		// Keep the journal so that nothing is lost
+		return;
+	}
+	g_Store.dirty = false;
+
+	// Everything in the journal is now in the data file
+	ClearJournal();
+}
+
+void OpenStore()
+{
+	// Get the path to the settings data file
+	g_Store.dataFile = RmGetSettingsFile();
+
+	// Read the whole section at once. The buffer is too small if the returned length is the
+	//  buffer size minus two.
+	std::vector<WCHAR> buffer(4096);
+	DWORD length;
+	while ((length = GetPrivateProfileSection(L"Plugin_DataHandling", buffer.data(), (DWORD)buffer.size(), g_Store.dataFile)) == buffer.size() - 2)
+	{
+		buffer.resize(buffer.size() * 2);
+	}
+
+	// The section is a list of "key=value" strings, terminated by an empty string
+	for (const WCHAR* pos = buffer.data(); *pos; pos += wcslen(pos) + 1)
+	{
+		const WCHAR* separator = wcschr(pos, L'=');
+		if (separator)
+		{
+			g_Store.values[std::wstring(pos, separator)] = _wtoi(separator + 1);
+		}
+	}
+
+	// The journal lives next to the data file
+	std::wstring journalFile = g_Store.dataFile;
+	journalFile.erase(journalFile.find_last_of(L'\\') + 1);
+	journalFile += L"Plugin_DataHandling.journal";
+
+	g_Store.journal = CreateFile(journalFile.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (g_Store.journal != INVALID_HANDLE_VALUE)
+	{
+		// Apply the changes that did not make it into the data file, then start with an empty
+		//  journal (this also gets rid of a damaged tail)
+		ReplayJournal();
+		if (g_Store.dirty)
+		{
+			FlushStore();
+		}
+		else
+		{
+			ClearJournal();
+		}
+		g_Store.lastSync = GetTickCount64();
+	}
+}
+
+// Called when the last measure is unloaded. The in-memory values and the journal stay open in
+//  case measures are loaded again (e.g. a refresh of the only skin that uses the plugin).
+void CloseStore()
+{
+	// If the data file cannot be written, the records must at least be in the journal
+	WriteJournal();
+	FlushStore();
+	StopSync();
+}
 
 PLUGIN_EXPORT void Initialize(void** data, void* rm)
 {
 	Measure* measure = new Measure;
 	*data = measure;
 
-	// Get the path to the settings data file
-	measure->dataFile = RmGetSettingsFile();
+	if (g_Store.measureCount++ == 0)
+	{
+		// The data is only read once per process
+		if (!g_Store.dataFile)
+		{
+			OpenStore();
+		}
+		StartSync();
+	}
+
+	measure->key = RmGetSkinName(rm);
+	measure->key += L'|';
+	measure->key += RmGetMeasureName(rm);
 }
 
 PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
@@ -77,18 +486,27 @@ PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
 	// Get the starting value if one is defined
 	measure->counter = RmReadInt(rm, L"StartingValue", -1);
 
-	// If |StartingValue| was not defined with with measure, read the |Count| from the data file
+	// If |StartingValue| was not defined with with measure, use the value stored for this
+	//  measure. If there is no value stored yet, 0 will be used as the default value.
 	if (measure->counter < 0)
 	{
-		// Get |Count| from the Rainmeter data file. If the key does not exist
-		//  in the data file, 0 will be used as the default value.
-		measure->counter = (int)GetPrivateProfileInt(L"Plugin_DataHandling", L"Count", 0, measure->dataFile);
+		auto iter = g_Store.values.find(measure->key);
+		measure->counter = iter != g_Store.values.end() ? iter->second : 0;
 	}
 
 	// If the counter is to be saved in the data file, set SaveData=1 in the measure (in the
-	//  skin file).  The counter will be saved to the |Count| key in the data file when the
-	//  skin is unloaded or refreshed.
+	//  skin file).  The counter will be stored when the skin is unloaded or refreshed.
 	measure->saveData = RmReadInt(rm, L"SaveData", 0) == 1 ? true : false;
+	measure->storedValue = measure->saveData ? &g_Store.values[measure->key] : nullptr;
+
+	// The journal settings are shared by all measures, the most recently read values are used
+	if (measure->saveData)
+	{
+		int syncUpdates = RmReadInt(rm, L"SyncUpdates", 100);
+		double syncSeconds = RmReadDouble(rm, L"SyncSeconds", 10.0);
+		g_Store.syncUpdates = syncUpdates > 0 ? (DWORD)syncUpdates : 1;
+		g_Store.syncInterval = syncSeconds > 0.0 ? (ULONGLONG)(syncSeconds * 1000.0) : 0;
+	}
 }
 
 PLUGIN_EXPORT double Update(void* data)
@@ -99,6 +517,26 @@ PLUGIN_EXPORT double Update(void* data)
 	// Increase the counter and reset if needed.
 	if (++measure->counter < 0)	measure->counter = 0;
 
+	if (measure->storedValue)
+	{
+		*measure->storedValue = measure->counter;
+		g_Store.dirty = true;
+		AppendJournal(measure, measure->counter);
+
+		// Keep the journal small
+		const size_t compactRecords = g_Store.values.size() * COMPACT_RECORDS_PER_VALUE;
+		if (g_Store.journalRecords >= COMPACT_RECORDS && g_Store.journalRecords >= compactRecords)
+		{
+			FlushStore();
+		}
+	}
+
+	// Write pending changes once things have settled down
+	if (g_Store.flushPending && GetTickCount64() - g_Store.lastChange >= FLUSH_DELAY)
+	{
+		FlushStore();
+	}
+
 	return measure->counter;
 }
 
@@ -106,13 +544,26 @@ PLUGIN_EXPORT void Finalize(void* data)
 {
 	Measure* measure = (Measure*)data;
 
+	// |g_Store.pendingMeasures| must not keep a pointer to the deleted measure
+	if (measure->pendingRecord)
+	{
+		WriteJournal();
+	}
+
 	if (measure->saveData)
 	{
-		// Note: In this example multiple |DataHandling| plugin measures (from any skin) will
-		//  overwrite this value. The counter from the last measure unloaded will persist.
-		WCHAR buffer[SHRT_MAX];
-		_itow_s(measure->counter, buffer, 10);
-		WritePrivateProfileString(L"Plugin_DataHandling", L"Count", buffer, measure->dataFile);
+		// Only update the in-memory copy here. When a skin is refreshed, the new measures
+		//  will read the value back from memory.
+		g_Store.values[measure->key] = measure->counter;
+		g_Store.dirty = true;
+		g_Store.flushPending = true;
+		g_Store.lastChange = GetTickCount64();
+	}
+
+	// Write the data file when the last measure is unloaded (e.g. when Rainmeter is closed)
+	if (--g_Store.measureCount == 0)
+	{
+		CloseStore();
 	}
 
 	delete measure;
@@ -5,6 +5,10 @@
 
 // Note: GetString, ExecuteBang and an unnamed function for use as a section variable
 // have been commented out. Uncomment any functions as needed.
+// Strings returned by GetString and section variable functions must stay valid after the
+// function returns, so return a pointer into a buffer owned by the measure (not a local).
+// Strings returned by RmReadString and friends are owned by Rainmeter and only valid until the
+// next Rm call, so copy them to e.g. a std::wstring if they are needed later.
 // For more information, see the SDK docs: https://docs.rainmeter.net/developers/plugin/cpp/
 
 struct Measure
@@ -8,6 +8,16 @@
 #include <Windows.h>
 #include "../../API/RainmeterAPI.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 // Overview: This example demonstrates a basic implementation of a parent/child
@@ -19,6 +29,28 @@
 // information from some data set. The child measures can then be used to return
 // specific information from the data queried by the parent measure.
 
+// Note: The parent collects its data on a separate thread every |SampleInterval|
+// milliseconds, so a slow data source never stalls the skin. The update functions
+// only pick up the most recently collected values and never wait for the thread. Only
+// the first data is collected by Reload, so that it is available to the first update.
+// New data is only handed over when it differs from the previous data.
+
+// Messages from the sampling thread are not logged directly. They are queued and logged
+// by the update functions on the skin thread. With |Debug=1| on the parent, the sampling
+// thread logs the collected data. A message that is the same as the previous one is not
+// logged again.
+
+// Any measure can keep the values of its last |HistorySize| updates. Statistics over the
+// last |count| values (or all of them if |count| is omitted) are available as section
+// variables:
+//   Avg([count])
+//   Min([count])
+//   Max([count])
+//   StdDev([count])
+//   Percentile(percent[, count])  e.g. Percentile(95, 300), interpolated between values
+// The average of all values is kept up to date as values are added, the other functions go
+// over the values when they are used. Nothing is returned while there are no values.
+
 // Sample skin:
 /*
 	[Rainmeter]
@@ -33,6 +65,7 @@
 	ValueA=111
 	ValueB=222
 	ValueC=333
+	SampleInterval=1000
 	Type=A
 
 	[mChild1]
@@ -40,6 +73,7 @@
 	Plugin=ParentChild
 	ParentName=mParent
 	Type=B
+	HistorySize=60
 
 	[mChild2]
 	Measure=Plugin
@@ -53,6 +87,12 @@
 	MeasureName2=mChild1
 	MeasureName3=mChild2
 	Text="mParent: %1#CRLF#mChild1: %2#CRLF#mChild2: %3"
+
+	[TextStats]
+	Meter=String
+	Y=5R
+	Text=mChild1 average: [mChild1:Avg(10)], max: [mChild1:Max()], 95th percentile: [mChild1:Percentile(95)]
+	DynamicVariables=1
 */
 
 enum MeasureType
@@ -64,68 +104,468 @@ enum MeasureType
 
 struct ChildMeasure;
 
-struct ParentMeasure
+// Upper limit for |HistorySize|, e.g. a day of values with Update=1000
+const int MAX_HISTORY_SIZE = 86400;
+
+// Values of the last updates of a measure, kept in a ring buffer
+struct History
 {
-	void* skin;
-	LPCWSTR name;
-	ChildMeasure* ownerChild;
+	std::vector<double> samples;
+	size_t next;  // Position of the next value
+	size_t count;  // Number of values, at most |samples.size()|
+	double sum;  // Sum of all values for the average
+
+	std::vector<double> scratch;  // Reused by Percentile
+
+	History() :
+		samples(),
+		next(0),
+		count(0),
+		sum(0.0),
+		scratch() {}
+};
 
+// Options of the parent that are used to collect the data
+struct SourceOptions
+{
 	int valueA;
 	int valueB;
 	int valueC;
 
-	ParentMeasure() : 
-		skin(nullptr),
-		name(nullptr),
-		ownerChild(nullptr),
+	SourceOptions() :
 		valueA(0),
 		valueB(0),
 		valueC(0) {}
 };
 
+// Data collected by the parent. A snapshot is never modified once it has been published.
+struct Snapshot
+{
+	int valueA;
+	int valueB;
+	int valueC;
+
+	Snapshot() :
+		valueA(0),
+		valueB(0),
+		valueC(0) {}
+};
+
+struct ParentMeasure
+{
+	void* skin;
+	std::wstring name;  // Lowercase, see FoldName
+	ChildMeasure* ownerChild;
+	std::vector<ChildMeasure*> children;
+
+	// Shared with the sampling thread, protected by |mutex|
+	std::mutex mutex;
+	std::condition_variable wake;
+	SourceOptions options;
+	DWORD sampleInterval;
+	bool debug;
+	bool reloaded;
+	bool stop;
+
+	// Messages of the sampling thread waiting to be logged, also protected by |mutex|
+	std::vector<std::pair<int, std::wstring>> messages;
+	std::wstring lastMessage;
+	std::atomic<bool> hasMessages;
+
+	// The sampling thread hands a new snapshot over by swapping it into |latest|. The skin
+	//  thread takes it out of there and keeps it in |current| for the update functions.
+	std::atomic<Snapshot*> latest;
+	Snapshot* current;
+	std::thread sampler;
+
+	ParentMeasure() : 
+		skin(nullptr),
+		name(),
+		ownerChild(nullptr),
+		children(),
+		options(),
+		sampleInterval(1000),
+		debug(false),
+		reloaded(false),
+		stop(false),
+		messages(),
+		lastMessage(),
+		hasMessages(false),
+		latest(nullptr),
+		current(nullptr) {}
+};
+
 struct ChildMeasure
 {
 	MeasureType type;
+	std::wstring typeStr;
+	bool typeRead;
 	ParentMeasure* parent;
 
+	void* rm;
+	void* skin;
+	std::wstring parentName;  // Lowercase, empty for parent measures
+	size_t index;  // Position in either |parent->children| or the pending list
+	bool loggedParent;
+
+	History history;
+	std::wstring stat;  // Result of the last statistics function
+
 	ChildMeasure() : 
 		type(MEASURE_A),
-		parent(nullptr) {}
+		typeStr(),
+		typeRead(false),
+		parent(nullptr),
+		rm(nullptr),
+		skin(nullptr),
+		parentName(),
+		index(0),
+		loggedParent(false),
+		history(),
+		stat() {}
 };
 
-std::vector<ParentMeasure*> g_ParentMeasures;
+// Parents are looked up by skin handle AND by name to be sure that the right one is found.
+//  Both lookups are hashed so that skins with thousands of children do not have to scan
+//  every parent of every skin.
+typedef std::unordered_map<std::wstring, ParentMeasure*> ParentMap;
+std::unordered_map<void*, ParentMap> g_ParentMeasures;
+
+// Children that were initialized before their parent (e.g. the child is defined above the
+//  parent in the skin) wait here and are bound as soon as the parent is initialized.
+typedef std::unordered_map<std::wstring, std::vector<ChildMeasure*>> ChildMap;
+std::unordered_map<void*, ChildMap> g_PendingChildren;
+
+// Measure names are case-insensitive, so they are stored in lowercase.
+std::wstring FoldName(LPCWSTR name)
+{
+	std::wstring folded = name;
+	CharLowerBuff(&folded[0], (DWORD)folded.length());
+	return folded;
+}
+
+// Children are kept in unordered lists and remember their position in it, so that they can
+//  be removed by swapping with the last element.
+void AddChild(std::vector<ChildMeasure*>& children, ChildMeasure* child)
+{
+	child->index = children.size();
+	children.push_back(child);
+}
+
+void RemoveChild(std::vector<ChildMeasure*>& children, ChildMeasure* child)
+{
+	ChildMeasure* last = children.back();
+	children[child->index] = last;
+	last->index = child->index;
+	children.pop_back();
+}
+
+void AddPendingChild(ChildMeasure* child)
+{
+	AddChild(g_PendingChildren[child->skin][child->parentName], child);
+}
+
+void RemovePendingChild(ChildMeasure* child)
+{
+	auto skinIter = g_PendingChildren.find(child->skin);
+	if (skinIter == g_PendingChildren.end()) return;
+
+	auto iter = skinIter->second.find(child->parentName);
+	if (iter == skinIter->second.end()) return;
+
+	RemoveChild(iter->second, child);
+	if (iter->second.empty())
+	{
+		skinIter->second.erase(iter);
+		if (skinIter->second.empty()) g_PendingChildren.erase(skinIter);
+	}
+}
+
+ParentMeasure* FindParent(void* skin, const std::wstring& name)
+{
+	auto skinIter = g_ParentMeasures.find(skin);
+	if (skinIter == g_ParentMeasures.end()) return nullptr;
+
+	auto iter = skinIter->second.find(name);
+	return iter != skinIter->second.end() ? iter->second : nullptr;
+}
+
+void RegisterParent(ParentMeasure* parent)
+{
+	g_ParentMeasures[parent->skin][parent->name] = parent;
+
+	// Bind the children that are waiting for this parent
+	auto skinIter = g_PendingChildren.find(parent->skin);
+	if (skinIter == g_PendingChildren.end()) return;
+
+	auto iter = skinIter->second.find(parent->name);
+	if (iter == skinIter->second.end()) return;
+
+	for (ChildMeasure* child : iter->second)
+	{
+		child->parent = parent;
+		AddChild(parent->children, child);
+	}
+
+	skinIter->second.erase(iter);
+	if (skinIter->second.empty()) g_PendingChildren.erase(skinIter);
+}
+
+void UnregisterParent(ParentMeasure* parent)
+{
+	auto skinIter = g_ParentMeasures.find(parent->skin);
+	if (skinIter != g_ParentMeasures.end())
+	{
+		skinIter->second.erase(parent->name);
+		if (skinIter->second.empty()) g_ParentMeasures.erase(skinIter);
+	}
+
+	// The remaining children must not keep a pointer to the deleted parent. They go back to
+	//  the pending list in case a parent with the same name is initialized again.
+	for (ChildMeasure* child : parent->children)
+	{
+		child->parent = nullptr;
+		AddPendingChild(child);
+	}
+	parent->children.clear();
+}
+
+// This is where the data set is queried. A real plugin would talk to its data source here
+//  (e.g. WMI or performance counters), which is fine since this is not the skin thread.
+void CollectData(const SourceOptions& options, Snapshot& snapshot)
+{
+	snapshot.valueA = options.valueA;
+	snapshot.valueB = options.valueB;
+	snapshot.valueC = options.valueC;
+}
+
+bool HasChanged(const Snapshot& data, const Snapshot& previous)
+{
+	return data.valueA != previous.valueA ||
+		data.valueB != previous.valueB ||
+		data.valueC != previous.valueC;
+}
+
+void ResetHistory(History& history)
+{
+	history.next = 0;
+	history.count = 0;
+	history.sum = 0.0;
+}
+
+void ResizeHistory(History& history, size_t size)
+{
+	if (history.samples.size() != size)
+	{
+		history.samples.assign(size, 0.0);
+		history.scratch.clear();
+		history.scratch.shrink_to_fit();
+		ResetHistory(history);
+	}
+}
+
+void AddSample(History& history, double value)
+{
+	const size_t size = history.samples.size();
+	if (size == 0) return;
+
+	if (history.count == size)
+	{
+		history.sum -= history.samples[history.next];
+	}
+	else
+	{
+		++history.count;
+	}
+
+	history.samples[history.next] = value;
+	history.sum += value;
+
+	if (++history.next == size)
+	{
+		// Add the values up again once per round so that rounding errors do not accumulate
+		history.next = 0;
+		history.sum = std::accumulate(history.samples.begin(), history.samples.end(), 0.0);
+	}
+}
+
+// Calls |func| for the last |count| values, which are in at most two contiguous ranges. The
+//  ranges passed to |func| are never empty.
+template<typename Func>
+void ForEachRange(const History& history, size_t count, Func func)
+{
+	const double* samples = history.samples.data();
+	if (count <= history.next)
+	{
+		if (count > 0) func(samples + history.next - count, samples + history.next);
+	}
+	else
+	{
+		const size_t size = history.samples.size();
+		func(samples + size - (count - history.next), samples + size);
+		if (history.next > 0) func(samples, samples + history.next);
+	}
+}
+
+// Returns the number of values to use for a statistics function, |argv[index]| is optional
+size_t GetSampleCount(const History& history, const int argc, const WCHAR* argv[], int index)
+{
+	if (argc > index)
+	{
+		const int count = _wtoi(argv[index]);
+		if (count > 0 && (size_t)count < history.count) return (size_t)count;
+	}
+	return history.count;
+}
+
+LPCWSTR FormatStat(ChildMeasure* child, double value)
+{
+	WCHAR buffer[64];
+	_snwprintf_s(buffer, _TRUNCATE, L"%.15g", value);
+	child->stat = buffer;
+	return child->stat.c_str();
+}
+
+// Upper limit for the number of queued messages, e.g. if the skin is not updated
+const size_t MAX_MESSAGES = 100;
+
+// Queues a message of the sampling thread, |parent->mutex| must be locked
+void QueueLog(ParentMeasure* parent, int level, LPCWSTR message)
+{
+	if (parent->lastMessage == message || parent->messages.size() >= MAX_MESSAGES)
+	{
+		return;
+	}
+
+	parent->lastMessage = message;
+	parent->messages.emplace_back(level, parent->lastMessage);
+	parent->hasMessages = true;
+}
+
+// Logs the queued messages of the sampling thread. This is only called from the update
+//  functions, which all run on the skin thread.
+void FlushLog(ParentMeasure* parent)
+{
+	if (!parent->hasMessages) return;
+
+	std::vector<std::pair<int, std::wstring>> messages;
+	{
+		std::lock_guard<std::mutex> lock(parent->mutex);
+		messages.swap(parent->messages);
+		parent->hasMessages = false;
+	}
+
+	for (const auto& message : messages)
+	{
+		RmLog(parent->ownerChild->rm, message.first, message.second.c_str());
+	}
+}
+
+// Hands new data over to the skin thread, |parent->mutex| must be locked
+void PublishSnapshot(ParentMeasure* parent, const Snapshot& data)
+{
+	// A snapshot that the skin thread has not picked up yet is simply replaced
+	delete parent->latest.exchange(new Snapshot(data));
+
+	if (parent->debug)
+	{
+		// Only format the message if it is going to be logged
+		WCHAR buffer[128];
+		_snwprintf_s(buffer, _TRUNCATE, L"New data: A=%i, B=%i, C=%i",
+			data.valueA, data.valueB, data.valueC);
+		QueueLog(parent, LOG_DEBUG, buffer);
+	}
+}
+
+// |previous| is the data that has been published by Reload before the thread was started
+void SampleThread(ParentMeasure* parent, Snapshot previous)
+{
+	std::unique_lock<std::mutex> lock(parent->mutex);
+	while (true)
+	{
+		parent->wake.wait_for(lock, std::chrono::milliseconds(parent->sampleInterval),
+			[parent] { return parent->stop || parent->reloaded; });
+		if (parent->stop) break;
+
+		SourceOptions options = parent->options;
+		parent->reloaded = false;
+		lock.unlock();
+
+		Snapshot data;
+		CollectData(options, data);
+		lock.lock();
+
+		// Nothing is published if the data has not changed
+		if (HasChanged(data, previous))
+		{
+			PublishSnapshot(parent, data);
+			previous = data;
+		}
+	}
+}
+
+// Returns the most recent snapshot of the parent without blocking. This is only called from
+//  the update functions, which all run on the skin thread.
+const Snapshot* GetSnapshot(ParentMeasure* parent)
+{
+	FlushLog(parent);
+
+	Snapshot* snapshot = parent->latest.exchange(nullptr);
+	if (snapshot)
+	{
+		delete parent->current;
+		parent->current = snapshot;
+	}
+	return parent->current;
+}
+
+void StopSampling(ParentMeasure* parent)
+{
+	if (parent->sampler.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(parent->mutex);
+			parent->stop = true;
+		}
+		parent->wake.notify_one();
+		parent->sampler.join();
+	}
+
+	delete parent->latest.exchange(nullptr);
+	delete parent->current;
+	parent->current = nullptr;
+}
 
 PLUGIN_EXPORT void Initialize(void** data, void* rm)
 {
 	ChildMeasure* child = new ChildMeasure;
 	*data = child;
 
-	void* skin = RmGetSkin(rm);
+	child->rm = rm;
+	child->skin = RmGetSkin(rm);
 
 	LPCWSTR parentName = RmReadString(rm, L"ParentName", L"");
 	if (!*parentName)
 	{
 		child->parent = new ParentMeasure;
-		child->parent->name = RmGetMeasureName(rm);
-		child->parent->skin = skin;
+		child->parent->name = FoldName(RmGetMeasureName(rm));
+		child->parent->skin = child->skin;
 		child->parent->ownerChild = child;
-		g_ParentMeasures.push_back(child->parent);
+		RegisterParent(child->parent);
 	}
 	else
 	{
-		// Find parent using name AND the skin handle to be sure that it's the right one
-		std::vector<ParentMeasure*>::const_iterator iter = g_ParentMeasures.begin();
-		for ( ; iter != g_ParentMeasures.end(); ++iter)
+		child->parentName = FoldName(parentName);
+		child->parent = FindParent(child->skin, child->parentName);
+		if (child->parent)
 		{
-			if (_wcsicmp((*iter)->name, parentName) == 0 &&
-				(*iter)->skin == skin)
-			{
-				child->parent = (*iter);
-				return;
-			}
+			AddChild(child->parent->children, child);
+		}
+		else
+		{
+			// The parent might not be initialized yet, so the child is bound later
+			AddPendingChild(child);
 		}
-
-		RmLog(rm, LOG_ERROR, L"Invalid \"ParentName\"");
 	}
 }
 
@@ -134,36 +574,86 @@ PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
 	ChildMeasure* child = (ChildMeasure*)data;
 	ParentMeasure* parent = child->parent;
 
-	if (!parent)
-	{
-		return;
-	}
-
-	// Read common options
+	// Read common options. With |DynamicVariables=1| this is done on every update cycle,
+	//  so |Type| is only parsed again when its raw value has changed.
 	LPCWSTR type = RmReadString(rm, L"Type", L"");
-	if (_wcsicmp(type, L"A") == 0)
-	{
-		child->type = MEASURE_A;
-	}
-	else if (_wcsicmp(type, L"B") == 0)
-	{
-		child->type = MEASURE_B;
-	}
-	else if (_wcsicmp(type, L"C") == 0)
-	{
-		child->type = MEASURE_C;
-	}
-	else
+	if (!child->typeRead || child->typeStr != type)
 	{
-		RmLog(rm, LOG_ERROR, L"Invalid \"Type\"");
+		child->typeStr = type;
+		child->typeRead = true;
+		ResetHistory(child->history);
+
+		if (_wcsicmp(type, L"A") == 0)
+		{
+			child->type = MEASURE_A;
+		}
+		else if (_wcsicmp(type, L"B") == 0)
+		{
+			child->type = MEASURE_B;
+		}
+		else if (_wcsicmp(type, L"C") == 0)
+		{
+			child->type = MEASURE_C;
+		}
+		else
+		{
+			RmLog(rm, LOG_ERROR, L"Invalid \"Type\"");
+		}
 	}
 
+	int historySize = RmReadInt(rm, L"HistorySize", 0);
+	if (historySize < 0) historySize = 0;
+	else if (historySize > MAX_HISTORY_SIZE) historySize = MAX_HISTORY_SIZE;
+	ResizeHistory(child->history, (size_t)historySize);
+
 	// Read parent specific options
-	if (parent->ownerChild == child)
+	if (parent && parent->ownerChild == child)
 	{
-		parent->valueA = RmReadInt(rm, L"ValueA", 0);
-		parent->valueB = RmReadInt(rm, L"ValueB", 0);
-		parent->valueC = RmReadInt(rm, L"ValueC", 0);
+		SourceOptions options;
+		options.valueA = RmReadInt(rm, L"ValueA", 0);
+		options.valueB = RmReadInt(rm, L"ValueB", 0);
+		options.valueC = RmReadInt(rm, L"ValueC", 0);
+
+		int sampleInterval = RmReadInt(rm, L"SampleInterval", 1000);
+
+		bool debug = RmReadInt(rm, L"Debug", 0) == 1;
+
+		bool changed;
+		{
+			std::lock_guard<std::mutex> lock(parent->mutex);
+
+			// With |DynamicVariables=1| this is done on every update cycle, so the data is
+			//  only collected again right away if an option has actually changed.
+			const DWORD interval = sampleInterval > 0 ? (DWORD)sampleInterval : 1000;
+			changed = options.valueA != parent->options.valueA ||
+				options.valueB != parent->options.valueB ||
+				options.valueC != parent->options.valueC ||
+				interval != parent->sampleInterval;
+
+			parent->options = options;
+			parent->sampleInterval = interval;
+			parent->debug = debug;
+			if (changed) parent->reloaded = true;
+		}
+
+		if (parent->sampler.joinable())
+		{
+			// Collect the data again right away with the new options
+			if (changed) parent->wake.notify_one();
+		}
+		else
+		{
+			// The first data is collected right away, so that the first update after the skin
+			//  has been loaded does not have to wait for the sampling thread
+			Snapshot data;
+			CollectData(options, data);
+			{
+				std::lock_guard<std::mutex> lock(parent->mutex);
+				PublishSnapshot(parent, data);
+				parent->reloaded = false;
+			}
+			parent->sampler = std::thread(SampleThread, parent, data);
+		}
 	}
 }
 
@@ -174,22 +664,155 @@ PLUGIN_EXPORT double Update(void* data)
 
 	if (!parent)
 	{
+		// All measures of the skin are initialized before the first update, so the parent
+		//  does not exist if it has not been found by now.
+		if (!child->loggedParent)
+		{
+			RmLog(child->rm, LOG_ERROR, L"Invalid \"ParentName\"");
+			child->loggedParent = true;
+		}
+		return 0.0;
+	}
+
+	const Snapshot* snapshot = GetSnapshot(parent);
+	if (!snapshot)
+	{
+		// No data has been collected yet
 		return 0.0;
 	}
 
+	double value = 0.0;
 	switch (child->type)
 	{
 	case MEASURE_A:
-		return (double)parent->valueA;
+		value = (double)snapshot->valueA;
+		break;
 
 	case MEASURE_B:
-		return (double)parent->valueB;
+		value = (double)snapshot->valueB;
+		break;
 
 	case MEASURE_C:
-		return (double)parent->valueC;
+		value = (double)snapshot->valueC;
+		break;
 	}
 
-	return 0.0;
+	AddSample(child->history, value);
+	return value;
+}
+
+PLUGIN_EXPORT LPCWSTR Avg(void* data, const int argc, const WCHAR* argv[])
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	const History& history = child->history;
+	if (history.count == 0) return nullptr;
+
+	const size_t count = GetSampleCount(history, argc, argv, 0);
+	if (count == history.count)
+	{
+		return FormatStat(child, history.sum / count);
+	}
+
+	double sum = 0.0;
+	ForEachRange(history, count, [&sum](const double* begin, const double* end)
+	{
+		sum = std::accumulate(begin, end, sum);
+	});
+	return FormatStat(child, sum / count);
+}
+
+PLUGIN_EXPORT LPCWSTR Min(void* data, const int argc, const WCHAR* argv[])
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	const History& history = child->history;
+	if (history.count == 0) return nullptr;
+
+	double result = HUGE_VAL;
+	ForEachRange(history, GetSampleCount(history, argc, argv, 0), [&result](const double* begin, const double* end)
+	{
+		const double value = *std::min_element(begin, end);
+		if (value < result) result = value;
+	});
+	return FormatStat(child, result);
+}
+
+PLUGIN_EXPORT LPCWSTR Max(void* data, const int argc, const WCHAR* argv[])
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	const History& history = child->history;
+	if (history.count == 0) return nullptr;
+
+	double result = -HUGE_VAL;
+	ForEachRange(history, GetSampleCount(history, argc, argv, 0), [&result](const double* begin, const double* end)
+	{
+		const double value = *std::max_element(begin, end);
+		if (value > result) result = value;
+	});
+	return FormatStat(child, result);
+}
+
+PLUGIN_EXPORT LPCWSTR StdDev(void* data, const int argc, const WCHAR* argv[])
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	const History& history = child->history;
+	if (history.count == 0) return nullptr;
+
+	const size_t count = GetSampleCount(history, argc, argv, 0);
+
+	double sum = 0.0;
+	ForEachRange(history, count, [&sum](const double* begin, const double* end)
+	{
+		sum = std::accumulate(begin, end, sum);
+	});
+	const double mean = sum / count;
+
+	// Deviations from the mean are summed in a second pass, which is more accurate than
+	//  subtracting the square of the mean from the mean of the squares
+	double squares = 0.0;
+	ForEachRange(history, count, [&squares, mean](const double* begin, const double* end)
+	{
+		for (const double* value = begin; value != end; ++value)
+		{
+			squares += (*value - mean) * (*value - mean);
+		}
+	});
+	return FormatStat(child, sqrt(squares / count));
+}
+
+PLUGIN_EXPORT LPCWSTR Percentile(void* data, const int argc, const WCHAR* argv[])
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	History& history = child->history;
+	if (history.count == 0 || argc < 1) return nullptr;
+
+	double percent = wcstod(argv[0], nullptr);
+	if (std::isnan(percent)) return nullptr;
+
+	if (percent < 0.0) percent = 0.0;
+	else if (percent > 100.0) percent = 100.0;
+
+	const size_t count = GetSampleCount(history, argc, argv, 1);
+
+	// Only the values around the requested rank need to be in order
+	std::vector<double>& values = history.scratch;
+	values.clear();
+	ForEachRange(history, count, [&values](const double* begin, const double* end)
+	{
+		values.insert(values.end(), begin, end);
+	});
+
+	const double rank = percent / 100.0 * (count - 1);
+	const size_t lower = (size_t)rank;
+	auto nth = values.begin() + lower;
+	std::nth_element(values.begin(), nth, values.end());
+
+	double result = *nth;
+	if (lower + 1 < count)
+	{
+		const double upper = *std::min_element(nth + 1, values.end());
+		result += (upper - result) * (rank - lower);
+	}
+	return FormatStat(child, result);
 }
 
 PLUGIN_EXPORT void Finalize(void* data)
@@ -199,11 +822,18 @@ PLUGIN_EXPORT void Finalize(void* data)
 
 	if (parent && parent->ownerChild == child)
 	{
-		g_ParentMeasures.erase(
-			std::remove(g_ParentMeasures.begin(),g_ParentMeasures.end(),parent),
-			g_ParentMeasures.end());
+		StopSampling(parent);
+		UnregisterParent(parent);
 		delete parent;
 	}
+	else if (parent)
+	{
+		RemoveChild(parent->children, child);
+	}
+	else if (!child->parentName.empty())
+	{
+		RemovePendingChild(child);
+	}
 
 	delete child;
 }
@@ -7,11 +7,35 @@
 
 #include <Windows.h>
 #include "../../API/RainmeterAPI.h"
-#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 // Overview: This is an example of how to make an option be read and execute the bang within.
 
+// The |Timer| option is the period in seconds (fractions are allowed) at which |OnTimer| is
+// executed. Deadlines are kept on a monotonic clock and the next deadline is always the previous
+// deadline plus the period, so the timer does not drift and is not affected by changes of the
+// system time. Since the measure can only act when it is updated, |CatchUp| controls what
+// happens when one or more deadlines have passed since the last update:
+//   CatchUp=Once  Execute the action once (default).
+//   CatchUp=All   Execute the action once for every deadline that has passed.
+//   CatchUp=Skip  Execute the action only if no more than one deadline has passed.
+// Variables in the action are replaced when the option is read, so all executions of a catch-up
+// see the same values. CatchUp=All is meant for actions whose effect adds up when they are
+// repeated, e.g. logging or sending a command to another measure.
+
+// Instead of executing each action right away, the actions of all RmExecute measures of a skin
+// are queued and executed together with a single RmExecute call at the end of the update cycle
+// (i.e. in the update of the last RmExecute measure in the skin). With |Coalesce=1|, an action
+// is not queued again if the exact same action is already waiting to be executed. This only
+// makes a difference for actions whose effect adds up when they are repeated (e.g. !Log), since
+// the copies of an action are identical strings with the same variable values.
+
 // Sample skin:
 /*
 	[Rainmeter]
@@ -29,6 +53,7 @@
 	Plugin=RmExecute
 	Timer=#Timer#
 	OnTimer=[!SetOption Example1 Text "This text has changed!"]
+	Coalesce=1
 
 	[mTimer2]
 	Measure=Plugin
@@ -37,6 +62,13 @@
 	OnTimer=[!SetVariable Count "(#Count# + 1)"]
 	DynamicVariables=1
 
+	[mTimer3]
+	Measure=Plugin
+	Plugin=RmExecute
+	Timer=0.25
+	OnTimer=[!Log "mTimer3 deadline"]
+	CatchUp=All
+
 	[Example1]
 	Meter=String
 	Text=This text has not changed yet.
@@ -48,56 +80,253 @@
 	DynamicVariables=1
 */
 
+typedef std::chrono::steady_clock Clock;
+typedef std::chrono::duration<double> Seconds;
+
+enum CatchUp
+{
+	CATCHUP_ONCE,
+	CATCHUP_ALL,
+	CATCHUP_SKIP
+};
+
+// Upper limit for CatchUp=All, e.g. after the computer has been sleeping for a long time
+const long long MAX_CATCHUP = 100;
+
+struct Measure;
+
+// Actions waiting to be executed in a skin
+struct SkinQueue
+{
+	std::vector<std::wstring> commands;
+	std::vector<std::wstring> executing;
+	std::wstring batch;
+
+	std::vector<Measure*> measures;  // In the order they are updated
+	std::atomic<Measure*> first;  // Measure that queued the first action of the current batch
+
+	SkinQueue() :
+		commands(),
+		executing(),
+		batch(),
+		measures(),
+		first(nullptr) {}
+};
+
 struct Measure
 {
 	std::wstring command;
 	double updateRate;
-	time_t timer;
+	CatchUp catchUp;
+	bool coalesce;
+	Clock::time_point deadline;
 
 	void* skin;  // Pointer to the skin (needed for RmExecute)
+	SkinQueue* queue;
 
 	Measure() :
 		command(),
 		updateRate(0),
-		timer(std::time(nullptr)),  // You can also do this in the Initalize function
-		skin(nullptr) {}
+		catchUp(CATCHUP_ONCE),
+		coalesce(false),
+		deadline(Clock::now()),  // You can also do this in the Initalize function
+		skin(nullptr),
+		queue(nullptr) {}
 };
 
+// Actions may be queued from any thread, so the queues are protected by |g_QueueMutex|
+std::mutex g_QueueMutex;
+std::unordered_map<void*, SkinQueue> g_Queues;
+
+void QueueCommand(Measure* measure, const std::wstring& command)
+{
+	if (command.empty()) return;
+
+	std::lock_guard<std::mutex> lock(g_QueueMutex);
+	SkinQueue* queue = measure->queue;
+
+	if (measure->coalesce &&
+		std::find(queue->commands.begin(), queue->commands.end(), command) != queue->commands.end())
+	{
+		return;
+	}
+
+	if (queue->commands.empty())
+	{
+		queue->first = measure;
+	}
+	queue->commands.push_back(command);
+}
+
+// Executes all queued actions of the skin with a single call to RmExecute. This must be
+//  called from the update functions, which run on the skin thread.
+void ExecuteQueue(Measure* measure)
+{
+	SkinQueue* queue = measure->queue;
+	{
+		std::lock_guard<std::mutex> lock(g_QueueMutex);
+		if (queue->commands.empty()) return;
+
+		queue->executing.swap(queue->commands);
+		queue->first = nullptr;
+	}
+
+	// Each action is put in brackets so that they can be executed as one multi-bang
+	std::wstring& batch = queue->batch;
+	batch.clear();
+	for (const std::wstring& command : queue->executing)
+	{
+		if (command[0] == L'[')
+		{
+			batch += command;
+		}
+		else
+		{
+			batch += L'[';
+			batch += command;
+			batch += L']';
+		}
+	}
+	queue->executing.clear();
+
+	RmExecute(measure->skin, batch.c_str());
+}
+
 PLUGIN_EXPORT void Initialize(void** data, void* rm)
 {
 	Measure* measure = new Measure;
 	*data = measure;
 
 	measure->skin = RmGetSkin(rm);
+
+	// Measures are initialized in the same order as they are updated
+	std::lock_guard<std::mutex> lock(g_QueueMutex);
+	measure->queue = &g_Queues[measure->skin];
+	measure->queue->measures.push_back(measure);
 }
 
 PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
 {
 	Measure* measure = (Measure*)data;
-	measure->updateRate = RmReadDouble(rm, L"Timer", 1.0);
+
+	// Note: If |DynamicVariables=1| is set on the measure, this function will get called on
+	//  every update cycle. Only reschedule the timer when the period has actually changed.
+	double updateRate = RmReadDouble(rm, L"Timer", 1.0);
+	if (updateRate != measure->updateRate)
+	{
+		// Start from the last time the timer fired (or from when the measure was created)
+		Clock::time_point previous = measure->deadline;
+		if (measure->updateRate > 0.0)
+		{
+			previous -= std::chrono::duration_cast<Clock::duration>(Seconds(measure->updateRate));
+		}
+
+		measure->updateRate = updateRate;
+		measure->deadline = previous + std::chrono::duration_cast<Clock::duration>(Seconds(updateRate > 0.0 ? updateRate : 0.0));
+	}
+
+	LPCWSTR catchUp = RmReadString(rm, L"CatchUp", L"Once");
+	if (_wcsicmp(catchUp, L"All") == 0)
+	{
+		measure->catchUp = CATCHUP_ALL;
+	}
+	else if (_wcsicmp(catchUp, L"Skip") == 0)
+	{
+		measure->catchUp = CATCHUP_SKIP;
+	}
+	else
+	{
+		measure->catchUp = CATCHUP_ONCE;
+	}
 
 	// When reading an action, do not replace any section variables in the option so
 	//  that when the action is executed, the most recent value of the measure will be
-	//  used. Note the boolean parameter.
+	//  used. Note the boolean parameter. Variables (e.g. #Count#) are replaced right away.
 	measure->command = RmReadString(rm, L"OnTimer", L"", FALSE);
+
+	measure->coalesce = RmReadInt(rm, L"Coalesce", 0) == 1;
 }
 
 PLUGIN_EXPORT double Update(void* data)
 {
 	Measure* measure = (Measure*)data;
 
-	double difference = std::difftime(time(nullptr), measure->timer);
-	if (difference >= measure->updateRate)
+	// If this measure queued the first action of the batch, a whole update cycle has passed
+	//  without the batch being executed (e.g. the last measure of the skin is disabled)
+	if (measure->queue->first == measure)
 	{
-		RmExecute(measure->skin, measure->command.c_str());
-		measure->timer = std::time(nullptr);
+		ExecuteQueue(measure);
 	}
 
-	return measure->updateRate - difference;
+	double remaining = 0.0;
+	Clock::time_point now = Clock::now();
+	if (now >= measure->deadline)
+	{
+		const Clock::duration period = std::chrono::duration_cast<Clock::duration>(Seconds(measure->updateRate));
+		if (period <= Clock::duration::zero())
+		{
+			// Without a period, execute on every update
+			QueueCommand(measure, measure->command);
+			measure->deadline = now;
+		}
+		else
+		{
+			// Number of deadlines that have passed since the last update
+			const long long missed = (now - measure->deadline) / period + 1;
+
+			long long count = 1;
+			if (measure->catchUp == CATCHUP_ALL)
+			{
+				count = missed < MAX_CATCHUP ? missed : MAX_CATCHUP;
+			}
+			else if (measure->catchUp == CATCHUP_SKIP && missed > 1)
+			{
+				count = 0;
+			}
+
+			for (long long i = 0; i < count; ++i)
+			{
+				QueueCommand(measure, measure->command);
+			}
+
+			// Keep the original schedule instead of counting from now
+			measure->deadline += missed * period;
+			remaining = std::chrono::duration_cast<Seconds>(measure->deadline - now).count();
+		}
+	}
+	else
+	{
+		remaining = std::chrono::duration_cast<Seconds>(measure->deadline - now).count();
+	}
+
+	// The last measure of the skin executes the actions queued during this update cycle
+	if (measure->queue->measures.back() == measure)
+	{
+		ExecuteQueue(measure);
+	}
+
+	return remaining;
 }
 
 PLUGIN_EXPORT void Finalize(void* data)
 {
 	Measure* measure = (Measure*)data;
+
+	{
+		std::lock_guard<std::mutex> lock(g_QueueMutex);
+		SkinQueue* queue = measure->queue;
+		queue->measures.erase(std::find(queue->measures.begin(), queue->measures.end(), measure));
+		if (queue->first == measure)
+		{
+			queue->first = queue->measures.empty() ? nullptr : queue->measures.back();
+		}
+
+		// Actions that are still queued when the skin is unloaded are dropped
+		if (queue->measures.empty())
+		{
+			g_Queues.erase(measure->skin);
+		}
+	}
+
 	delete measure;
 }
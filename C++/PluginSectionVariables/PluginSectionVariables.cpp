@@ -7,14 +7,33 @@
 
 #include <Windows.h>
 #include "../../API/RainmeterAPI.h"
-#include <algorithm>
-#include <cwctype>
+#include <cstdio>
+#include <regex>
 #include <string>
+#include <unordered_map>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 // Overview: This example demonstrates using plugin section variables.
 // In this example we build a ToUpper and a ToLower section variable that can either get the measure text 
 // or transform the string passed to uppercase/lowercase
 
+// Section variables can be evaluated many times per update cycle, so the conversion is done in
+// place in a buffer that is reused, ASCII text is converted 8 characters at a time, and the
+// result of the last call is returned right away if the same string is converted again.
+
+// There are also a few general purpose string functions. Positions are 1-based and negative
+// positions count from the end (-1 is the last character or item). Invalid arguments make the
+// function return nothing, so the section variable is left as is.
+//   Substr(text, start[, length])
+//   Replace(text, find, replacement)
+//   Trim(text)
+//   Pad(text, width[, character])  Pads on the left, or on the right if |width| is negative
+//   Split(text, delimiter, index)
+//   NumberFormat(number[, decimals[, separator]])  e.g. 1234567.891, 2 -> 1,234,567.89
+//   Match(text, pattern[, group])  ECMAScript regular expression
+
 // Sample skin:
 /*
 	[Rainmeter]
@@ -46,18 +65,147 @@
 
 	; Because actions do not replace section variables when read, DynamicVariables=1 is not needed
 	LeftMouseUpAction=[!SetOption TextUpper Text "[mString:ToUpper(#TextString#)]"]
+
+	[TextFunctions]
+	Meter=String
+	Y=5R
+	Text=[mString:Split(a;b;c,;,-1)] [mString:NumberFormat(1234567.891,2)] [mString:Match(Build 19045,\d+)]
+	DynamicVariables=1
 */
 
+enum CaseType
+{
+	CASE_NONE,
+	CASE_UPPER,
+	CASE_LOWER
+};
+
 struct Measure
 {
 	std::wstring inputStr;
 	std::wstring buffer;
 
+	// Input and type of the last conversion, the result is in |buffer|
+	std::wstring lastInput;
+	CaseType lastCase;
+
+	// Regular expressions are compiled once per pattern
+	std::unordered_map<std::wstring, std::wregex> regexCache;
+	std::wcmatch match;
+
 	Measure() :
 		inputStr(),
-		buffer() {}
+		buffer(),
+		lastInput(),
+		lastCase(CASE_NONE),
+		regexCache(),
+		match() {}
 };
 
+// Upper limit for the number of compiled patterns kept by a measure
+const size_t MAX_REGEX_CACHE = 32;
+
+// Upper limit for the width of Pad
+const int MAX_PAD_WIDTH = 4096;
+
+// Returns the buffer for the result of a function. The buffer is shared with ToUpper/ToLower,
+//  so their cached result is no longer valid.
+std::wstring& GetResult(Measure* measure)
+{
+	measure->lastCase = CASE_NONE;
+	measure->buffer.clear();
+	return measure->buffer;
+}
+
+// Converts a 1-based (or negative) position to an index in the [0, length] range
+size_t ToIndex(LPCWSTR position, size_t length)
+{
+	long long index = _wtoi(position);
+	if (index > 0)
+	{
+		--index;
+	}
+	else if (index < 0)
+	{
+		index += (long long)length;
+		if (index < 0) index = 0;
+	}
+	return (size_t)index < length ? (size_t)index : length;
+}
+
+// Converts |length| characters of |str| in place. ASCII characters are converted directly and
+//  anything else is left to the system tables. Surrogate pairs are never changed.
+void ConvertCase(WCHAR* str, size_t length, CaseType type)
+{
+	const WCHAR first = (type == CASE_UPPER) ? L'a' : L'A';
+	const WCHAR last = (type == CASE_UPPER) ? L'z' : L'Z';
+	size_t i = 0;
+
+#if defined(_M_IX86) || defined(_M_X64)
+	const __m128i nonAscii = _mm_set1_epi16((short)0xFF80);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i below = _mm_set1_epi16((short)(first - 1));
+	const __m128i above = _mm_set1_epi16((short)(last + 1));
+	const __m128i caseBit = _mm_set1_epi16(0x20);
+
+	for (; i + 8 <= length; i += 8)
+	{
+		__m128i chars = _mm_loadu_si128((const __m128i*)(str + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chars, nonAscii), zero)) != 0xFFFF)
+		{
+			// Not all ASCII
+			if (type == CASE_UPPER) CharUpperBuff(str + i, 8);
+			else CharLowerBuff(str + i, 8);
+			continue;
+		}
+
+		// Flip the case bit of the characters in the [first, last] range
+		__m128i inRange = _mm_and_si128(_mm_cmpgt_epi16(chars, below), _mm_cmplt_epi16(chars, above));
+		chars = _mm_xor_si128(chars, _mm_and_si128(inRange, caseBit));
+		_mm_storeu_si128((__m128i*)(str + i), chars);
+	}
+#endif
+
+	for (; i < length; ++i)
+	{
+		WCHAR ch = str[i];
+		if (ch < 0x80)
+		{
+			if (ch >= first && ch <= last) str[i] = ch ^ 0x20;
+		}
+		else if (type == CASE_UPPER)
+		{
+			CharUpperBuff(str + i, 1);
+		}
+		else
+		{
+			CharLowerBuff(str + i, 1);
+		}
+	}
+}
+
+LPCWSTR TransformCase(Measure* measure, const int argc, const WCHAR* argv[], CaseType type)
+{
+	//If there was an argument passed to the function transform that (only the first argument)
+	//Else transform the |Input| option
+	LPCWSTR input = (argc > 0) ? argv[0] : measure->inputStr.c_str();
+
+	// Nothing to do if this is the same as the last conversion
+	if (type == measure->lastCase && measure->lastInput == input)
+	{
+		return measure->buffer.c_str();
+	}
+
+	measure->lastInput = input;
+	measure->lastCase = type;
+	measure->buffer = measure->lastInput;
+	if (!measure->buffer.empty())
+	{
+		ConvertCase(&measure->buffer[0], measure->buffer.length(), type);
+	}
+	return measure->buffer.c_str();
+}
+
 PLUGIN_EXPORT void Initialize(void** data, void* rm)
 {
 	Measure* measure = new Measure;
@@ -85,39 +233,202 @@ PLUGIN_EXPORT LPCWSTR GetString(void* data)
 PLUGIN_EXPORT LPCWSTR ToUpper(void* data, const int argc, const WCHAR* argv[])
 {
 	Measure* measure = (Measure*)data;
+	return TransformCase(measure, argc, argv, CASE_UPPER);
+}
 
-	//If there was an argument passed to the function transform that
-	if (argc > 0)
+PLUGIN_EXPORT LPCWSTR ToLower(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	return TransformCase(measure, argc, argv, CASE_LOWER);
+}
+
+PLUGIN_EXPORT LPCWSTR Substr(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	if (argc < 2) return nullptr;
+
+	const size_t length = wcslen(argv[0]);
+	const size_t start = ToIndex(argv[1], length);
+	size_t count = length - start;
+	if (argc > 2)
 	{
-		measure->buffer = argv[0];  // Only transform the first argument
+		int maxCount = _wtoi(argv[2]);
+		if (maxCount < 0) maxCount = 0;
+		if ((size_t)maxCount < count) count = (size_t)maxCount;
 	}
-	//Else transform the |Input| option
-	else
+
+	std::wstring& result = GetResult(measure);
+	result.assign(argv[0] + start, count);
+	return result.c_str();
+}
+
+PLUGIN_EXPORT LPCWSTR Replace(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	if (argc < 3) return nullptr;
+
+	std::wstring& result = GetResult(measure);
+	const size_t findLength = wcslen(argv[1]);
+	if (findLength == 0)
 	{
-		measure->buffer = measure->inputStr;
+		result = argv[0];
+		return result.c_str();
 	}
 
-	std::transform(measure->buffer.begin(), measure->buffer.end(), measure->buffer.begin(), std::towupper);
-	return measure->buffer.c_str();
+	LPCWSTR pos = argv[0];
+	while (LPCWSTR found = wcsstr(pos, argv[1]))
+	{
+		result.append(pos, found - pos);
+		result += argv[2];
+		pos = found + findLength;
+	}
+	result += pos;
+	return result.c_str();
 }
 
-PLUGIN_EXPORT LPCWSTR ToLower(void* data, const int argc, const WCHAR* argv[])
+PLUGIN_EXPORT LPCWSTR Trim(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	if (argc < 1) return nullptr;
+
+	const WCHAR* whitespace = L" \t\r\n";
+	LPCWSTR start = argv[0];
+	while (*start && wcschr(whitespace, *start)) ++start;
+
+	LPCWSTR end = start + wcslen(start);
+	while (end > start && wcschr(whitespace, *(end - 1))) --end;
+
+	std::wstring& result = GetResult(measure);
+	result.assign(start, end - start);
+	return result.c_str();
+}
+
+PLUGIN_EXPORT LPCWSTR Pad(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	if (argc < 2) return nullptr;
+
+	int width = _wtoi(argv[1]);
+	if (width > MAX_PAD_WIDTH) width = MAX_PAD_WIDTH;
+	else if (width < -MAX_PAD_WIDTH) width = -MAX_PAD_WIDTH;
+	const size_t size = (size_t)(width < 0 ? -width : width);
+	const WCHAR character = (argc > 2 && *argv[2]) ? *argv[2] : L' ';
+	const size_t length = wcslen(argv[0]);
+
+	std::wstring& result = GetResult(measure);
+	if (width > 0 && length < size) result.append(size - length, character);
+	result.append(argv[0], length);
+	if (width < 0 && length < size) result.append(size - length, character);
+	return result.c_str();
+}
+
+PLUGIN_EXPORT LPCWSTR Split(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	if (argc < 3) return nullptr;
+
+	const size_t delimiterLength = wcslen(argv[1]);
+	if (delimiterLength == 0) return nullptr;
+
+	int index = _wtoi(argv[2]);
+	if (index < 0)
+	{
+		// Count the items to find the position from the end
+		int count = 1;
+		for (LPCWSTR pos = argv[0]; (pos = wcsstr(pos, argv[1])) != nullptr; pos += delimiterLength)
+		{
+			++count;
+		}
+		index += count + 1;
+	}
+	if (index < 1) return nullptr;
+
+	LPCWSTR start = argv[0];
+	for (int i = 1; i < index; ++i)
+	{
+		start = wcsstr(start, argv[1]);
+		if (!start) return nullptr;
+		start += delimiterLength;
+	}
+
+	LPCWSTR end = wcsstr(start, argv[1]);
+	std::wstring& result = GetResult(measure);
+	result.assign(start, end ? (size_t)(end - start) : wcslen(start));
+	return result.c_str();
+}
+
+PLUGIN_EXPORT LPCWSTR NumberFormat(void* data, const int argc, const WCHAR* argv[])
 {
 	Measure* measure = (Measure*)data;
+	if (argc < 1) return nullptr;
+
+	const double number = wcstod(argv[0], nullptr);
+	int decimals = (argc > 1) ? _wtoi(argv[1]) : 0;
+	if (decimals < 0) decimals = 0;
+	else if (decimals > 10) decimals = 10;
+	LPCWSTR separator = (argc > 2) ? argv[2] : L",";
+
+	WCHAR buffer[512];
+	_snwprintf_s(buffer, _TRUNCATE, L"%.*f", decimals, number);
 
-	//If there was an argument passed to the function transform that
-	if (argc > 0)
+	// Insert the separator between groups of three digits of the integer part
+	LPCWSTR digits = (*buffer == L'-') ? buffer + 1 : buffer;
+	size_t integerLength = 0;
+	while (digits[integerLength] >= L'0' && digits[integerLength] <= L'9') ++integerLength;
+
+	std::wstring& result = GetResult(measure);
+	result.assign(buffer, digits - buffer);
+	for (size_t i = 0; i < integerLength; ++i)
 	{
-		measure->buffer = argv[0];  // Only transform the first argument
+		if (i > 0 && (integerLength - i) % 3 == 0)
+		{
+			result += separator;
+		}
+		result += digits[i];
 	}
-	//Else transform the |Input| option
-	else
+	result += digits + integerLength;
+	return result.c_str();
+}
+
+PLUGIN_EXPORT LPCWSTR Match(void* data, const int argc, const WCHAR* argv[])
+{
+	Measure* measure = (Measure*)data;
+	if (argc < 2) return nullptr;
+
+	auto iter = measure->regexCache.find(argv[1]);
+	if (iter == measure->regexCache.end())
 	{
-		measure->buffer = measure->inputStr;
+		if (measure->regexCache.size() >= MAX_REGEX_CACHE)
+		{
+			measure->regexCache.clear();
+		}
+
+		try
+		{
+			iter = measure->regexCache.emplace(argv[1], std::wregex(argv[1])).first;
+		}
+		catch (const std::regex_error&)
+		{
+			return nullptr;
+		}
 	}
 
-	std::transform(measure->buffer.begin(), measure->buffer.end(), measure->buffer.begin(), std::towlower);
-	return measure->buffer.c_str();
+	const int group = (argc > 2) ? _wtoi(argv[2]) : 0;
+	std::wstring& result = GetResult(measure);
+	try
+	{
+		// Searching can fail as well, e.g. if the pattern is too complex for the text
+		if (std::regex_search(argv[0], measure->match, iter->second) &&
+			group >= 0 && (size_t)group < measure->match.size())
+		{
+			result.assign(measure->match[group].first, measure->match[group].second);
+		}
+	}
+	catch (const std::regex_error&)
+	{
+		return nullptr;
+	}
+	return result.c_str();
 }
 
 PLUGIN_EXPORT void Finalize(void* data)
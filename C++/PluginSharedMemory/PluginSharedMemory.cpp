@@ -0,0 +1,532 @@
+/* Copyright (C) 2017 Rainmeter Project Developers
+ *
+ * This Source Code Form is subject to the terms of the GNU General Public
+ * License; either version 2 of the License, or (at your option) any later
+ * version. If a copy of the GPL was not distributed with this file, You can
+ * obtain one at <https://www.gnu.org/licenses/gpl-2.0.html>. */
+
+#include <Windows.h>
+#include "../../API/RainmeterAPI.h"
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Overview: This example demonstrates reading values that another process writes to shared
+// memory, using the parent/child structure of the ParentChild example. The parent measure
+// opens the shared memory named by |MappingName| and returns the number of updates that the
+// producer has written so far. The child measures return the field given by |Field| (0 is
+// the first field).
+
+// The values are read directly from the shared memory when the measures are updated, so
+// there is no file or pipe to poll and nothing is copied. The producer and the measures never
+// wait for each other either: the producer makes |sequence| odd while it is writing, and a
+// value is only used if |sequence| was even and unchanged while it was read. Otherwise the
+// value is read again, and if the producer kept writing the whole time, the measure keeps
+// its previous value. Each measure reads its field on its own, so the values of different
+// measures can be from different updates of the producer.
+
+// The shared memory is opened again every second until it exists and is valid, so the
+// producer can be started after the skin. The producer should create the shared memory with
+// the largest size it needs, since a producer that is started again gets the existing one.
+
+// Sample skin:
+/*
+	[Rainmeter]
+	Update=1000
+	DynamicWindowSize=1
+	BackgroundMode=2
+	SolidColor=255,255,255
+
+	[mParent]
+	Measure=Plugin
+	Plugin=SharedMemory
+	MappingName=Local\SharedMemorySample
+
+	[mField0]
+	Measure=Plugin
+	Plugin=SharedMemory
+	ParentName=mParent
+	Field=0
+
+	[mField1]
+	Measure=Plugin
+	Plugin=SharedMemory
+	ParentName=mParent
+	Field=1
+
+	[Text]
+	Meter=String
+	MeasureName=mParent
+	MeasureName2=mField0
+	MeasureName3=mField1
+	Text="Updates: %1#CRLF#Field 0: %2#CRLF#Field 1: %3"
+*/
+
+// Sample producer:
+/*
+	const DWORD count = 2;
+	const DWORD size = offsetof(SharedData, fields) + count * sizeof(double);
+	HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, L"Local\\SharedMemorySample");
+	SharedData* shared = (SharedData*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+	shared->magic = SHARED_MAGIC;
+	shared->version = SHARED_VERSION;
+	shared->count = count;
+
+	// Write 10000 times per second. Sleep cannot wait less than the timer resolution (about
+	//  15.6 ms by default), so the producer spins until the next deadline instead.
+	LARGE_INTEGER frequency, deadline, now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&deadline);
+	const LONGLONG period = frequency.QuadPart / 10000;
+
+	for (double value = 0.0; ; value += 1.0)
+	{
+		shared->sequence.fetch_add(1, std::memory_order_relaxed);  // Odd: writing
+		std::atomic_thread_fence(std::memory_order_release);
+		shared->fields[0] = value;
+		shared->fields[1] = value * 2.0;
+		shared->sequence.fetch_add(1, std::memory_order_release);  // Even: done
+
+		deadline.QuadPart += period;
+		do
+		{
+			YieldProcessor();
+			QueryPerformanceCounter(&now);
+		}
+		while (now.QuadPart < deadline.QuadPart);
+	}
+*/
+
+const DWORD SHARED_MAGIC = 0x4D534D52;  // "RMSM"
+const DWORD SHARED_VERSION = 1;
+
+// Layout of the shared memory. This must be the same in the producer.
+struct SharedData
+{
+	DWORD magic;
+	DWORD version;
+	std::atomic<DWORD> sequence;  // Odd while the producer is writing
+	DWORD count;  // Number of fields
+	double fields[1];  // |count| fields
+};
+
+static_assert(sizeof(std::atomic<DWORD>) == sizeof(DWORD), "std::atomic<DWORD> must not add state");
+
+// Number of times a value is read again while the producer is writing
+const int MAX_READ_ATTEMPTS = 100;
+
+// Time between attempts to open the shared memory
+const ULONGLONG OPEN_RETRY_DELAY = 1000;
+
+struct ChildMeasure;
+
+struct ParentMeasure
+{
+	void* skin;
+	std::wstring name;  // Lowercase, see FoldName
+	ChildMeasure* ownerChild;
+	std::vector<ChildMeasure*> children;
+
+	std::wstring mappingName;
+	HANDLE mapping;
+	const SharedData* shared;
+	DWORD fieldCount;  // Number of fields that fit in the shared memory
+	ULONGLONG nextOpen;  // Tick count of the next attempt to open the shared memory
+	bool loggedOpen;
+
+	ParentMeasure() :
+		skin(nullptr),
+		name(),
+		ownerChild(nullptr),
+		children(),
+		mappingName(),
+		mapping(nullptr),
+		shared(nullptr),
+		fieldCount(0),
+		nextOpen(0),
+		loggedOpen(false) {}
+};
+
+struct ChildMeasure
+{
+	ParentMeasure* parent;
+
+	void* rm;
+	void* skin;
+	std::wstring parentName;  // Lowercase, empty for parent measures
+	size_t index;  // Position in either |parent->children| or the pending list
+	bool loggedParent;
+	bool loggedField;
+
+	DWORD field;
+
+	// Value for the given |sequence| of the shared memory, only valid if |hasValue| is set
+	bool hasValue;
+	DWORD sequence;
+	double value;
+
+	ChildMeasure() :
+		parent(nullptr),
+		rm(nullptr),
+		skin(nullptr),
+		parentName(),
+		index(0),
+		loggedParent(false),
+		loggedField(false),
+		field(0),
+		hasValue(false),
+		sequence(0),
+		value(0.0) {}
+};
+
+// Parents are looked up by skin handle AND by name to be sure that the right one is found
+typedef std::unordered_map<std::wstring, ParentMeasure*> ParentMap;
+std::unordered_map<void*, ParentMap> g_ParentMeasures;
+
+// Children that were initialized before their parent wait here and are bound as soon as the
+//  parent is initialized. The functions below that manage parents and children are copied
+//  from the ParentChild example, since each example is a standalone project. A fix in one of
+//  them has to be made in both examples.
+typedef std::unordered_map<std::wstring, std::vector<ChildMeasure*>> ChildMap;
+std::unordered_map<void*, ChildMap> g_PendingChildren;
+
+// Measure names are case-insensitive, so they are stored in lowercase.
+std::wstring FoldName(LPCWSTR name)
+{
+	std::wstring folded = name;
+	CharLowerBuff(&folded[0], (DWORD)folded.length());
+	return folded;
+}
+
+// Forgets the value of the child, e.g. when it reads a different field or shared memory
+void ResetValue(ChildMeasure* child)
+{
+	child->hasValue = false;
+	child->sequence = 0;
+	child->value = 0.0;
+}
+
+// Children are kept in unordered lists and remember their position in it, so that they can
+//  be removed by swapping with the last element.
+void AddChild(std::vector<ChildMeasure*>& children, ChildMeasure* child)
+{
+	child->index = children.size();
+	children.push_back(child);
+}
+
+void RemoveChild(std::vector<ChildMeasure*>& children, ChildMeasure* child)
+{
+	ChildMeasure* last = children.back();
+	children[child->index] = last;
+	last->index = child->index;
+	children.pop_back();
+}
+
+void AddPendingChild(ChildMeasure* child)
+{
+	AddChild(g_PendingChildren[child->skin][child->parentName], child);
+}
+
+void RemovePendingChild(ChildMeasure* child)
+{
+	auto skinIter = g_PendingChildren.find(child->skin);
+	if (skinIter == g_PendingChildren.end()) return;
+
+	auto iter = skinIter->second.find(child->parentName);
+	if (iter == skinIter->second.end()) return;
+
+	RemoveChild(iter->second, child);
+	if (iter->second.empty())
+	{
+		skinIter->second.erase(iter);
+		if (skinIter->second.empty()) g_PendingChildren.erase(skinIter);
+	}
+}
+
+ParentMeasure* FindParent(void* skin, const std::wstring& name)
+{
+	auto skinIter = g_ParentMeasures.find(skin);
+	if (skinIter == g_ParentMeasures.end()) return nullptr;
+
+	auto iter = skinIter->second.find(name);
+	return iter != skinIter->second.end() ? iter->second : nullptr;
+}
+
+void RegisterParent(ParentMeasure* parent)
+{
+	g_ParentMeasures[parent->skin][parent->name] = parent;
+
+	// Bind the children that are waiting for this parent
+	auto skinIter = g_PendingChildren.find(parent->skin);
+	if (skinIter == g_PendingChildren.end()) return;
+
+	auto iter = skinIter->second.find(parent->name);
+	if (iter == skinIter->second.end()) return;
+
+	for (ChildMeasure* child : iter->second)
+	{
+		child->parent = parent;
+		AddChild(parent->children, child);
+	}
+
+	skinIter->second.erase(iter);
+	if (skinIter->second.empty()) g_PendingChildren.erase(skinIter);
+}
+
+void UnregisterParent(ParentMeasure* parent)
+{
+	auto skinIter = g_ParentMeasures.find(parent->skin);
+	if (skinIter != g_ParentMeasures.end())
+	{
+		skinIter->second.erase(parent->name);
+		if (skinIter->second.empty()) g_ParentMeasures.erase(skinIter);
+	}
+
+	// The remaining children must not keep a pointer to the deleted parent. They go back to
+	//  the pending list in case a parent with the same name is initialized again.
+	for (ChildMeasure* child : parent->children)
+	{
+		child->parent = nullptr;
+		ResetValue(child);
+		AddPendingChild(child);
+	}
+	parent->children.clear();
+}
+
+void CloseShared(ParentMeasure* parent)
+{
+	if (parent->shared)
+	{
+		UnmapViewOfFile(parent->shared);
+		parent->shared = nullptr;
+	}
+
+	if (parent->mapping)
+	{
+		CloseHandle(parent->mapping);
+		parent->mapping = nullptr;
+	}
+
+	parent->fieldCount = 0;
+	parent->nextOpen = 0;
+}
+
+bool OpenShared(ParentMeasure* parent)
+{
+	parent->mapping = OpenFileMapping(FILE_MAP_READ, FALSE, parent->mappingName.c_str());
+	if (parent->mapping)
+	{
+		parent->shared = (const SharedData*)MapViewOfFile(parent->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+
+	// Only the fields that are actually in the shared memory can be read
+	MEMORY_BASIC_INFORMATION info;
+	if (parent->shared && VirtualQuery(parent->shared, &info, sizeof(info)) &&
+		info.RegionSize >= offsetof(SharedData, fields) &&
+		parent->shared->magic == SHARED_MAGIC &&
+		parent->shared->version == SHARED_VERSION)
+	{
+		const size_t available = (info.RegionSize - offsetof(SharedData, fields)) / sizeof(double);
+		parent->fieldCount = (parent->shared->count < available) ? parent->shared->count : (DWORD)available;
+		parent->loggedOpen = false;
+		return true;
+	}
+
+	CloseShared(parent);
+	return false;
+}
+
+// Returns the shared memory of the parent, or nullptr if it is not available (yet)
+const SharedData* GetShared(ParentMeasure* parent)
+{
+	if (!parent->shared && !parent->mappingName.empty())
+	{
+		const ULONGLONG now = GetTickCount64();
+		if (now >= parent->nextOpen && !OpenShared(parent))
+		{
+			parent->nextOpen = now + OPEN_RETRY_DELAY;
+			if (!parent->loggedOpen)
+			{
+				RmLogF(parent->ownerChild->rm, LOG_NOTICE, L"Waiting for shared memory: %s", parent->mappingName.c_str());
+				parent->loggedOpen = true;
+			}
+		}
+	}
+
+	return parent->shared;
+}
+
+// Reads the field of the child from the shared memory. Returns false if the producer was
+//  writing every time the field was read, in which case the value of the child is not changed.
+//  If the field is already known for the current sequence, it is not read again.
+bool ReadField(const SharedData* shared, ChildMeasure* child)
+{
+	for (int i = 0; i < MAX_READ_ATTEMPTS; ++i)
+	{
+		const DWORD begin = shared->sequence.load(std::memory_order_acquire);
+		if (begin & 1)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		if (child->hasValue && begin == child->sequence)
+		{
+			return true;
+		}
+
+		const double result = *(const volatile double*)&shared->fields[child->field];
+
+		// The field must be read before the sequence is checked again
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (shared->sequence.load(std::memory_order_relaxed) == begin)
+		{
+			child->hasValue = true;
+			child->sequence = begin;
+			child->value = result;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+PLUGIN_EXPORT void Initialize(void** data, void* rm)
+{
+	ChildMeasure* child = new ChildMeasure;
+	*data = child;
+
+	child->rm = rm;
+	child->skin = RmGetSkin(rm);
+
+	LPCWSTR parentName = RmReadString(rm, L"ParentName", L"");
+	if (!*parentName)
+	{
+		child->parent = new ParentMeasure;
+		child->parent->name = FoldName(RmGetMeasureName(rm));
+		child->parent->skin = child->skin;
+		child->parent->ownerChild = child;
+		RegisterParent(child->parent);
+	}
+	else
+	{
+		child->parentName = FoldName(parentName);
+		child->parent = FindParent(child->skin, child->parentName);
+		if (child->parent)
+		{
+			AddChild(child->parent->children, child);
+		}
+		else
+		{
+			// The parent might not be initialized yet, so the child is bound later
+			AddPendingChild(child);
+		}
+	}
+}
+
+PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	ParentMeasure* parent = child->parent;
+
+	if (parent && parent->ownerChild == child)
+	{
+		LPCWSTR mappingName = RmReadString(rm, L"MappingName", L"");
+		if (parent->mappingName != mappingName)
+		{
+			CloseShared(parent);
+			parent->mappingName = mappingName;
+			parent->loggedOpen = false;
+
+			for (ChildMeasure* other : parent->children)
+			{
+				ResetValue(other);
+				other->loggedField = false;
+			}
+
+			if (parent->mappingName.empty())
+			{
+				RmLog(rm, LOG_ERROR, L"Invalid \"MappingName\"");
+			}
+		}
+	}
+	else
+	{
+		int field = RmReadInt(rm, L"Field", 0);
+		if (field < 0) field = 0;
+		if ((DWORD)field != child->field)
+		{
+			child->field = (DWORD)field;
+			ResetValue(child);
+			child->loggedField = false;
+		}
+	}
+}
+
+PLUGIN_EXPORT double Update(void* data)
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	ParentMeasure* parent = child->parent;
+
+	if (!parent)
+	{
+		// All measures of the skin are initialized before the first update, so the parent
+		//  does not exist if it has not been found by now.
+		if (!child->loggedParent)
+		{
+			RmLog(child->rm, LOG_ERROR, L"Invalid \"ParentName\"");
+			child->loggedParent = true;
+		}
+		return 0.0;
+	}
+
+	const SharedData* shared = GetShared(parent);
+	if (!shared)
+	{
+		return 0.0;
+	}
+
+	if (parent->ownerChild == child)
+	{
+		return (double)(shared->sequence.load(std::memory_order_relaxed) / 2);
+	}
+
+	if (child->field >= parent->fieldCount)
+	{
+		if (!child->loggedField)
+		{
+			RmLog(child->rm, LOG_ERROR, L"Invalid \"Field\"");
+			child->loggedField = true;
+		}
+		return 0.0;
+	}
+
+	// If the producer did not stop writing, the previous value is kept
+	ReadField(shared, child);
+	return child->value;
+}
+
+PLUGIN_EXPORT void Finalize(void* data)
+{
+	ChildMeasure* child = (ChildMeasure*)data;
+	ParentMeasure* parent = child->parent;
+
+	if (parent && parent->ownerChild == child)
+	{
+		CloseShared(parent);
+		UnregisterParent(parent);
+		delete parent;
+	}
+	else if (parent)
+	{
+		RemoveChild(parent->children, child);
+	}
+	else if (!child->parentName.empty())
+	{
+		RemovePendingChild(child);
+	}
+
+	delete child;
+}
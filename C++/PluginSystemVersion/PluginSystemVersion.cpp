@@ -12,6 +12,11 @@
 
 // Overview: This example demonstrates the basic concept of Rainmeter C++ plugins.
 
+// The system information cannot change while Rainmeter is running, so it is queried only once
+// for all measures (see GetSystemSnapshot). Each measure just keeps a pointer to the value it
+// returns. Besides the version, |Type| can also be Build, Processors or Memory (total physical
+// memory in bytes).
+
 // Sample skin:
 /*
 	[Rainmeter]
@@ -40,6 +45,11 @@
 	Plugin=SystemVersion
 	Type=Number
 
+	[mProcessors]
+	Measure=Plugin
+	Plugin=SystemVersion
+	Type=Processors
+
 	[Text1]
 	Meter=String
 	MeasureName=mString
@@ -57,6 +67,12 @@
 	NumOfDecimals=1
 	Y=5R
 	Text="String: %1#CRLF#Major: %2#CRLF#Minor: %3#CRLF#Number: %4#CRLF#"
+
+	[Text3]
+	Meter=String
+	MeasureName=mProcessors
+	Y=5R
+	Text="Processors: %1"
 */
 
 enum MeasureType
@@ -64,19 +80,89 @@ enum MeasureType
 	MEASURE_MAJOR,
 	MEASURE_MINOR,
 	MEASURE_NUMBER,
-	MEASURE_STRING
+	MEASURE_STRING,
+	MEASURE_BUILD,
+	MEASURE_PROCESSORS,
+	MEASURE_MEMORY
+};
+
+struct SystemSnapshot
+{
+	double major;
+	double minor;
+	double number;
+	double build;
+	double processors;
+	double memory;
+	std::wstring string;  // Empty if the version could not be retrieved
+
+	SystemSnapshot() :
+		major(0.0),
+		minor(0.0),
+		number(0.0),
+		build(0.0),
+		processors(0.0),
+		memory(0.0),
+		string() {}
 };
 
 struct Measure
 {
 	MeasureType type;
-	std::wstring strValue;
+	std::wstring typeStr;
+	bool typeRead;
+
+	// Point into the shared SystemSnapshot
+	const double* value;
+	LPCWSTR strValue;
 
 	Measure() :
 		type(MEASURE_MAJOR),
-		strValue() {}
+		typeStr(),
+		typeRead(false),
+		value(nullptr),
+		strValue(nullptr) {}
 };
 
+SystemSnapshot QuerySystem()
+{
+	SystemSnapshot snapshot;
+
+	OSVERSIONINFOEX osvi = {sizeof(OSVERSIONINFOEX)};
+	if (GetVersionEx((OSVERSIONINFO*)&osvi))
+	{
+		snapshot.major = (double)osvi.dwMajorVersion;
+		snapshot.minor = (double)osvi.dwMinorVersion;
+		snapshot.number = (double)osvi.dwMajorVersion + ((double)osvi.dwMinorVersion / 10.0);
+		snapshot.build = (double)osvi.dwBuildNumber;
+
+		WCHAR buffer[128];
+		_snwprintf_s(buffer, _TRUNCATE, L"%i.%i (Build %i)",
+			(int)osvi.dwMajorVersion, (int)osvi.dwMinorVersion, (int)osvi.dwBuildNumber);
+		snapshot.string = buffer;
+	}
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	snapshot.processors = (double)si.dwNumberOfProcessors;
+
+	MEMORYSTATUSEX memory = {sizeof(MEMORYSTATUSEX)};
+	if (GlobalMemoryStatusEx(&memory))
+	{
+		snapshot.memory = (double)memory.ullTotalPhys;
+	}
+
+	return snapshot;
+}
+
+const SystemSnapshot& GetSystemSnapshot()
+{
+	// A function-local static is initialized only once, on first use, even if this is called
+	//  from several threads at the same time.
+	static const SystemSnapshot snapshot = QuerySystem();
+	return snapshot;
+}
+
 PLUGIN_EXPORT void Initialize(void** data, void* rm)
 {
 	Measure* measure = new Measure;
@@ -88,6 +174,18 @@ PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
 	Measure* measure = (Measure*)data;
 
 	LPCWSTR value = RmReadString(rm, L"Type", L"");
+
+	// Note: If |DynamicVariables=1| is set on the measure, this function will get called
+	//  on every update cycle. Keep the raw value of |Type| and only parse it again (and
+	//  log an error if needed) when it has actually changed.
+	if (measure->typeRead && measure->typeStr == value)
+	{
+		return;
+	}
+
+	measure->typeStr = value;
+	measure->typeRead = true;
+
 	if (_wcsicmp(value, L"Major") == 0)
 	{
 		measure->type = MEASURE_MAJOR;
@@ -104,71 +202,83 @@ PLUGIN_EXPORT void Reload(void* data, void* rm, double* maxValue)
 	{
 		measure->type = MEASURE_STRING;
 	}
+	else if (_wcsicmp(value, L"Build") == 0)
+	{
+		measure->type = MEASURE_BUILD;
+	}
+	else if (_wcsicmp(value, L"Processors") == 0)
+	{
+		measure->type = MEASURE_PROCESSORS;
+	}
+	else if (_wcsicmp(value, L"Memory") == 0)
+	{
+		measure->type = MEASURE_MEMORY;
+	}
 	else
 	{
 		RmLog(rm, LOG_ERROR, L"Invalid \"Type\"");
 	}
-}
 
-PLUGIN_EXPORT double Update(void* data)
-{
-	Measure* measure = (Measure*)data;
-
-	OSVERSIONINFOEX osvi = {sizeof(OSVERSIONINFOEX)};
-	if (!GetVersionEx((OSVERSIONINFO*)&osvi))
-	{
-		return 0.0;
-	}
+	const SystemSnapshot& snapshot = GetSystemSnapshot();
+	measure->value = nullptr;
+	measure->strValue = nullptr;
 
 	switch (measure->type)
 	{
-	case MEASURE_MINOR:
-		return (double)osvi.dwMinorVersion;
-
 	case MEASURE_MAJOR:
-		return (double)osvi.dwMajorVersion;
+		measure->value = &snapshot.major;
+		break;
+
+	case MEASURE_MINOR:
+		measure->value = &snapshot.minor;
+		break;
 
 	case MEASURE_NUMBER:
-		return (double)osvi.dwMajorVersion + ((double)osvi.dwMinorVersion / 10.0);
+		measure->value = &snapshot.number;
+		break;
+
+	case MEASURE_BUILD:
+		measure->value = &snapshot.build;
+		break;
+
+	case MEASURE_PROCESSORS:
+		measure->value = &snapshot.processors;
+		break;
+
+	case MEASURE_MEMORY:
+		measure->value = &snapshot.memory;
+		break;
 
 	case MEASURE_STRING:
+		if (!snapshot.string.empty())
 		{
-			WCHAR buffer[128];
-			_snwprintf_s(buffer, _TRUNCATE, L"%i.%i (Build %i)",
-				(int)osvi.dwMajorVersion, (int)osvi.dwMinorVersion, (int)osvi.dwBuildNumber);
-			measure->strValue = buffer;
+			measure->strValue = snapshot.string.c_str();
 		}
 		break;
 	}
+}
 
-	// MEASURE_STRING is not a number and therefore will be returned in GetString. However it is
-	//  recommended that you do any processing here in the Update function rather than the GetString
-	//  function since GetString can be called multiple times during the update cycle. Store any
-	//  string values in your Measure structure and return it in GetString.
+PLUGIN_EXPORT double Update(void* data)
+{
+	Measure* measure = (Measure*)data;
+
+	// MEASURE_STRING is not a number and therefore will be returned in GetString. Since the
+	//  string never changes, it is formatted only once and there is nothing left to do here.
 
-	return 0.0;
+	return measure->value ? *measure->value : 0.0;
 }
 
 PLUGIN_EXPORT LPCWSTR GetString(void* data)
 {
 	Measure* measure = (Measure*)data;
 
-	// Although GetVersionEx is a rather inexpensive operation, it is recommended to
-	// do any processing in the Update function. See the comments above.
-	if (!measure->strValue.empty())
-	{
-		switch (measure->type)
-		{
-		case MEASURE_STRING:
-			return measure->strValue.c_str();
-		}
-	}
+	// The string is owned by the shared snapshot, so the pointer stays valid and the same
+	//  string is returned on every call.
 
-	// MEASURE_MAJOR, MEASURE_MINOR, and MEASURE_NUMBER are numbers. Therefore,
-	// |nullptr| is returned here for them. This is to inform Rainmeter that it can
-	// treat those types as numbers.
+	// Only MEASURE_STRING has a string. For the other types |nullptr| is returned to inform
+	// Rainmeter that it can treat those types as numbers.
 
-	return nullptr;
+	return measure->strValue;
 }
 
 PLUGIN_EXPORT void Finalize(void* data)